@@ -3,9 +3,28 @@
 #include <sstream>
 #include <vector>
 #include <map>
+#include <set>
 #include <ctime>
 #include <iomanip>
 #include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 using namespace std;
 
 // Status indicators for books
@@ -17,54 +36,335 @@ int getTodayAsInteger() {
     return static_cast<int>(now / (60 * 60 * 24));
 }
 
+// Number of worker threads for a parallel pass over the given number of
+// items: one per minPerThread items, since below that spawning a thread
+// costs more than it saves, capped at the hardware thread count
+size_t parallelWorkers(size_t items, size_t minPerThread) {
+    size_t workers = items / minPerThread + 1;
+    return min<size_t>(workers, max(1u, thread::hardware_concurrency()));
+}
+
+// CRC-32 (IEEE) of a string, used to validate records read back from disk
+uint32_t crc32Of(const string &data) {
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        tableReady = true;
+    }
+    uint32_t crc = 0xFFFFFFFFu;
+    for (unsigned char ch : data) {
+        crc = table[(crc ^ ch) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Prefix a record with its checksum: "<8 hex digits>|record"
+string withChecksum(const string &record) {
+    char prefix[10];
+    snprintf(prefix, sizeof(prefix), "%08x|", crc32Of(record));
+    return prefix + record;
+}
+
+// Replace a file's contents so that readers see either the old or the new
+// version, never a mix: write a temporary file, fsync it, then rename it
+// over the original
+bool replaceFileAtomically(const string &path, const string &contents) {
+    string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Cannot write " << tmpPath << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t n = ::write(fd, contents.data() + written, contents.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cerr << "Cannot write " << tmpPath << ": " << strerror(errno) << "\n";
+            ::close(fd);
+            return false;
+        }
+        written += n;
+    }
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    if (!synced || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        cerr << "Cannot replace " << path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    // Make the rename itself durable
+    string dir = filesystem::path(path).parent_path().string();
+    int dirFd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+    return true;
+}
+
+// True if the line has room for a checksum prefix ("<8 chars>|"). No
+// unprefixed record has a '|' before its first comma at that position.
+bool hasChecksumSlot(const string &line) {
+    return line.size() >= 9 && line[8] == '|' &&
+           line.find(',') > 8;
+}
+
+// Strip and verify the checksum prefix. A line without a valid prefix is
+// damaged.
+bool verifyChecksum(const string &line, string &record) {
+    if (!hasChecksumSlot(line) ||
+        line.find_first_not_of("0123456789abcdef") != 8) {
+        return false;
+    }
+    record = line.substr(9);
+    return static_cast<uint32_t>(stoul(line.substr(0, 8), nullptr, 16)) ==
+           crc32Of(record);
+}
+
+// Data files written before checksums were introduced have no prefix on
+// any line. Rewrite such a file once with checksums so that every later
+// read can treat an unprefixed line as damage. A file where even one line
+// has a prefix slot is left alone. Throws if the rewrite failed, since
+// loading on would discard every record as damaged.
+void addChecksumsToLegacyFile(const string &path) {
+    ifstream fin(path);
+    string line, contents;
+    bool any = false;
+    while (getline(fin, line)) {
+        if (hasChecksumSlot(line)) {
+            return;
+        }
+        any = true;
+        contents += withChecksum(line) + "\n";
+    }
+    if (!any) {
+        return;
+    }
+    fin.close();
+    cout << "Adding checksums to " << path << ".\n";
+    if (!replaceFileAtomically(path, contents)) {
+        throw runtime_error("cannot add checksums to " + path);
+    }
+}
+
+// Data files that lazily loaded records point into. A record keeps one
+// 64-bit handle: the file's index in this table and the byte offset of
+// its line. Each file is read through a single shared stream.
+class RecordStore {
+private:
+    struct Source {
+        string path;
+        // Segment records carry a "B,"/"U," kind prefix
+        bool segment;
+        mutex lock;
+        ifstream in;
+    };
+    static constexpr int OFFSET_BITS = 48;
+
+    static mutex registryLock;
+    static vector<unique_ptr<Source>> sources;
+
+    static Source &sourceOf(int64_t handle) {
+        lock_guard<mutex> guard(registryLock);
+        return *sources.at(handle >> OFFSET_BITS);
+    }
+
+public:
+    // Handle value for a record that is not on disk (held in memory)
+    static constexpr int64_t NOWHERE = -1;
+
+    // Register a file, or start reading it afresh after it was replaced
+    static int open(const string &path, bool segment) {
+        lock_guard<mutex> guard(registryLock);
+        for (size_t i = 0; i < sources.size(); i++) {
+            if (sources[i]->path == path) {
+                lock_guard<mutex> sourceGuard(sources[i]->lock);
+                sources[i]->in.close();
+                return static_cast<int>(i);
+            }
+        }
+        sources.emplace_back(new Source());
+        sources.back()->path = path;
+        sources.back()->segment = segment;
+        return static_cast<int>(sources.size() - 1);
+    }
+
+    static int64_t handle(int source, streamoff offset) {
+        return (static_cast<int64_t>(source) << OFFSET_BITS) | offset;
+    }
+
+    // Read a record back, without its kind prefix. Throws if it is
+    // missing or fails its checksum.
+    static string read(int64_t handle) {
+        Source &src = sourceOf(handle);
+        streamoff offset = handle & ((int64_t(1) << OFFSET_BITS) - 1);
+        string line, record;
+        {
+            lock_guard<mutex> guard(src.lock);
+            if (!src.in.is_open()) {
+                src.in.open(src.path);
+            }
+            src.in.clear();
+            src.in.seekg(offset);
+            getline(src.in, line);
+        }
+        if (!verifyChecksum(line, record)) {
+            throw runtime_error("cannot read record at " + src.path + ":" +
+                                to_string(offset));
+        }
+        return src.segment ? record.substr(record.find(',') + 1) : record;
+    }
+};
+
+mutex RecordStore::registryLock;
+vector<unique_ptr<RecordStore::Source>> RecordStore::sources;
+
+// Resident memory of this process in KiB (0 where /proc is unavailable)
+long residentKiB() {
+    ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    if (!(statm >> pages >> resident)) {
+        return 0;
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
 // --------------------
 // Book Class
 // --------------------
-class Book {
-private:
-    int id;
+// Descriptive metadata. It is kept out of line and shared between copies,
+// so a book whose metadata is still on disk costs only its hot fields.
+struct BookDetails {
     string title;
     string author;
     string publisher;
-    int year;
+    int year = 0;
     string isbn;
+};
+
+class Book {
+private:
+    int id;
     BookStatus status;
+    // Changed since it was last written to disk
+    bool dirty;
+    // Where the details are on disk (RecordStore handle) while they are
+    // not resident; a lazily loaded book reads them on first access
+    mutable int64_t coldAt;
+    mutable shared_ptr<const BookDetails> details;
+
+    // Make the details resident. Throws if they cannot be read; the
+    // location is kept, so a later attempt can still succeed.
+    void loadCold() const {
+        if (details) {
+            return;
+        }
+        Book full = deserialize(RecordStore::read(coldAt));
+        if (full.id != id) {
+            throw runtime_error("record for book " + to_string(id) +
+                                " is unreadable");
+        }
+        details = full.details;
+        coldAt = RecordStore::NOWHERE;
+    }
+
+    // The details, or a placeholder if they cannot be read right now
+    const BookDetails &cold() const {
+        static const BookDetails unreadable{"(unreadable)", "", "", 0, ""};
+        try {
+            loadCold();
+            return *details;
+        } catch (const exception &e) {
+            cerr << e.what() << "\n";
+            return unreadable;
+        }
+    }
+
+    // A clean book whose details are on disk
+    Book(int _id, BookStatus _status, int64_t where)
+        : id(_id), status(_status), dirty(false), coldAt(where) {}
+
+    // A private copy of the details to modify
+    BookDetails &editable() {
+        loadCold();
+        auto copy = make_shared<BookDetails>(*details);
+        details = copy;
+        dirty = true;
+        return *copy;
+    }
 
 public:
-    Book() : id(0), year(0), status(AVAILABLE) {}
+    Book()
+        : id(0), status(AVAILABLE), dirty(true), coldAt(RecordStore::NOWHERE),
+          details(make_shared<BookDetails>()) {}
 
     Book(int _id, const string &_title, const string &_author,
          const string &_publisher, int _year, const string &_isbn)
-        : id(_id), title(_title), author(_author), publisher(_publisher),
-          year(_year), isbn(_isbn), status(AVAILABLE) {}
+        : id(_id), status(AVAILABLE), dirty(true), coldAt(RecordStore::NOWHERE),
+          details(make_shared<BookDetails>(
+              BookDetails{_title, _author, _publisher, _year, _isbn})) {}
 
     // Accessors / Mutators
     int getId() const { return id; }
-    void setId(int _id) { id = _id; }
+    void setId(int _id) { loadCold(); id = _id; dirty = true; }
 
-    string getTitle() const { return title; }
-    void setTitle(const string &t) { title = t; }
+    string getTitle() const { return cold().title; }
+    void setTitle(const string &t) { editable().title = t; }
 
-    string getAuthor() const { return author; }
-    void setAuthor(const string &a) { author = a; }
+    string getAuthor() const { return cold().author; }
+    void setAuthor(const string &a) { editable().author = a; }
 
-    string getPublisher() const { return publisher; }
-    void setPublisher(const string &p) { publisher = p; }
+    string getPublisher() const { return cold().publisher; }
+    void setPublisher(const string &p) { editable().publisher = p; }
 
-    int getYear() const { return year; }
-    void setYear(int y) { year = y; }
+    int getYear() const { return cold().year; }
+    void setYear(int y) { editable().year = y; }
 
-    string getISBN() const { return isbn; }
-    void setISBN(const string &i) { isbn = i; }
+    string getISBN() const { return cold().isbn; }
+    void setISBN(const string &i) { editable().isbn = i; }
 
     BookStatus getStatus() const { return status; }
-    void setStatus(BookStatus s) { status = s; }
+    void setStatus(BookStatus s) { status = s; dirty = true; }
+
+    bool isDirty() const { return dirty; }
+    void markDirty() { dirty = true; }
+    void clearDirty() { dirty = false; }
+
+    // The title without making the details resident, for catalog scans
+    string peekTitle() const {
+        if (details) {
+            return details->title;
+        }
+        try {
+            return deserialize(RecordStore::read(coldAt)).getTitle();
+        } catch (const exception &e) {
+            cerr << e.what() << "\n";
+            return "";
+        }
+    }
+
+    // The record was just written at this location; drop the resident
+    // details and read them back from there when next needed
+    void evictCold(int64_t where) {
+        coldAt = where;
+        details.reset();
+    }
 
     // Display basic book info
     void printDetails() const {
-        cout << "Book ID: " << id << "\nTitle: " << title
-             << "\nAuthor: " << author << "\nPublisher: " << publisher
-             << "\nYear: " << year << "\nISBN: " << isbn
+        const BookDetails &d = cold();
+        cout << "Book ID: " << id << "\nTitle: " << d.title
+             << "\nAuthor: " << d.author << "\nPublisher: " << d.publisher
+             << "\nYear: " << d.year << "\nISBN: " << d.isbn
              << "\nStatus: "
              << (status == AVAILABLE ? "Available"
                                      : (status == BORROWED ? "Borrowed"
@@ -72,11 +372,14 @@ public:
              << "\n---------------------------" << endl;
     }
 
-    // Convert book data to a CSV string
+    // Convert book data to a CSV string. Throws if the details are on disk
+    // and cannot be read.
     string serialize() const {
+        loadCold();
         ostringstream oss;
-        oss << id << "," << title << "," << author << "," << publisher << ","
-            << year << "," << isbn << "," << status;
+        oss << id << "," << details->title << "," << details->author << ","
+            << details->publisher << "," << details->year << ","
+            << details->isbn << "," << status;
         return oss.str();
     }
 
@@ -94,8 +397,22 @@ public:
         Book b(stoi(fields[0]), fields[1], fields[2], fields[3],
                stoi(fields[4]), fields[5]);
         b.setStatus(static_cast<BookStatus>(stoi(fields[6])));
+        b.clearDirty();
         return b;
     }
+
+    // Rebuild only the hot fields (id, status) from CSV data; the rest is
+    // read from the given location on first access
+    static Book deserializeHot(const string &csvLine, int64_t where) {
+        size_t firstComma = csvLine.find(',');
+        size_t lastComma = csvLine.rfind(',');
+        if (count(csvLine.begin(), csvLine.end(), ',') < 6) {
+            return Book();
+        }
+        return Book(stoi(csvLine.substr(0, firstComma)),
+                    static_cast<BookStatus>(stoi(csvLine.substr(lastComma + 1))),
+                    where);
+    }
 };
 
 // --------------------
@@ -105,19 +422,80 @@ class Account {
 private:
     // Stores the books currently borrowed: bookId -> dueDay
     map<int, int> borrowedBooks;
-    // List of all previously returned books
-    vector<int> borrowingHistory;
+    // List of all previously returned books. With lazy loading it stays
+    // on disk until first accessed (see loadHistory)
+    mutable vector<int> borrowingHistory;
     double fineAmount;
+    // Changed since it was last written to disk
+    bool dirty;
+    // Where the history is on disk (RecordStore handle) while it is not
+    // resident
+    mutable int64_t historyAt;
+
+    static void parseHistory(const string &histStr, vector<int> &history) {
+        istringstream his(histStr);
+        string bid;
+        while (getline(his, bid, '-')) {
+            if (!bid.empty()) {
+                history.push_back(stoi(bid));
+            }
+        }
+    }
+
+    // The history is the "H:" field of the account data, which follows
+    // the type, id and name of the user record (the name may itself contain
+    // "H:"). Throws if the record cannot be read.
+    static vector<int> readHistory(int64_t where) {
+        vector<int> history;
+        string record = RecordStore::read(where);
+        size_t accStart = 0;
+        for (int field = 0; field < 3 && accStart != string::npos; field++) {
+            accStart = record.find(',', accStart);
+            accStart = accStart == string::npos ? accStart : accStart + 1;
+        }
+        if (accStart == string::npos) {
+            throw runtime_error("user record has no account data");
+        }
+        size_t pos = record.find(",H:", accStart);
+        if (pos != string::npos) {
+            string histStr = record.substr(pos + 3);
+            parseHistory(histStr.substr(0, histStr.find(',')), history);
+        }
+        return history;
+    }
+
+    // Make the history resident. Throws if it cannot be read; the location
+    // is kept, so a later attempt can still succeed.
+    void loadHistory() const {
+        if (historyAt != RecordStore::NOWHERE) {
+            borrowingHistory = readHistory(historyAt);
+            historyAt = RecordStore::NOWHERE;
+        }
+    }
 
 public:
-    Account() : fineAmount(0) {}
+    Account() : fineAmount(0), dirty(false), historyAt(RecordStore::NOWHERE) {}
+
+    // Read the history in if it is on disk; false if it cannot be read
+    // right now
+    bool ensureHistory() const {
+        try {
+            loadHistory();
+            return true;
+        } catch (const exception &e) {
+            cerr << e.what() << "\n";
+            return false;
+        }
+    }
 
     void addBorrowedBook(int bookId, int dueDay) {
         borrowedBooks[bookId] = dueDay;
+        dirty = true;
     }
 
     void removeBorrowedBook(int bookId) {
         borrowedBooks.erase(bookId);
+        dirty = true;
     }
 
     const map<int, int> &getBorrowedBooks() const {
@@ -125,27 +503,60 @@ public:
     }
 
     void addToHistory(int bookId) {
+        loadHistory();
         borrowingHistory.push_back(bookId);
+        dirty = true;
     }
 
+    // The history, or an empty one if it cannot be read right now
     const vector<int> &getHistory() const {
-        return borrowingHistory;
+        static const vector<int> unreadable;
+        return ensureHistory() ? borrowingHistory : unreadable;
+    }
+
+    // What another thread needs to read the history later without
+    // touching this account: its location, or a copy if it is resident
+    pair<int64_t, vector<int>> historySnapshot() const {
+        if (historyAt != RecordStore::NOWHERE) {
+            return {historyAt, {}};
+        }
+        return {RecordStore::NOWHERE, borrowingHistory};
+    }
+
+    // Read a snapshotted history; throws if it is on disk and unreadable
+    static vector<int> readSnapshot(const pair<int64_t, vector<int>> &snapshot) {
+        return snapshot.first != RecordStore::NOWHERE ? readHistory(snapshot.first)
+                                                      : snapshot.second;
+    }
+
+    // The record was just written at this location; drop the resident
+    // history and read it back from there when next needed
+    void evictHistory(int64_t where) {
+        historyAt = where;
+        vector<int>().swap(borrowingHistory);
     }
 
     void addFine(double amt) {
         fineAmount += amt;
+        dirty = true;
     }
 
     void clearFine() {
         fineAmount = 0;
+        dirty = true;
     }
 
     double getFine() const {
         return fineAmount;
     }
 
-    // Convert account info to a CSV-like string
+    bool isDirty() const { return dirty; }
+    void clearDirty() { dirty = false; }
+
+    // Convert account info to a CSV-like string. Throws if the history is
+    // on disk and cannot be read.
     string serialize() const {
+        loadHistory();
         ostringstream oss;
         oss << fineAmount;
         // Add borrowed book details
@@ -177,14 +588,7 @@ public:
         while (getline(iss, token, ',')) {
             if (token.rfind("H:", 0) == 0) {
                 // This is the history
-                string histStr = token.substr(2);
-                istringstream his(histStr);
-                string bid;
-                while (getline(his, bid, '-')) {
-                    if (!bid.empty()) {
-                        acc.borrowingHistory.push_back(stoi(bid));
-                    }
-                }
+                parseHistory(token.substr(2), acc.borrowingHistory);
             } else {
                 // Borrowed book info: "bookId:dueDay"
                 size_t pos = token.find(":");
@@ -198,6 +602,18 @@ public:
         return acc;
     }
 
+    // Rebuild the fine and borrowed books only; the history is read from
+    // the given location on first access
+    static Account deserializeHot(const string &data, int64_t where) {
+        Account acc;
+        size_t histPos = data.find(",H:");
+        acc = deserialize(data.substr(0, histPos));
+        if (histPos != string::npos) {
+            acc.historyAt = where;
+        }
+        return acc;
+    }
+
     // Display current fine, borrowed books, and history
     void printAccount() const {
         cout << "Fine: " << fineAmount << "\nBorrowed Books:\n";
@@ -206,13 +622,723 @@ public:
                  << "\n";
         }
         cout << "Borrowing History: ";
-        for (auto &h : borrowingHistory) {
+        for (auto &h : getHistory()) {
             cout << h << " ";
         }
         cout << "\n";
     }
 };
 
+// --------------------
+// RecommendationEngine Class
+// --------------------
+// "Patrons who borrowed X also borrowed Y": a co-occurrence matrix over
+// every borrowing history, holding a bounded number of candidates per
+// title, plus a precomputed top-k list per title so serving a
+// recommendation is a plain lookup.
+class RecommendationEngine {
+private:
+    static constexpr size_t TOP_K = 5;
+    // Candidates tracked per title; bounds the matrix to this many entries
+    // per row however many distinct titles are co-borrowed
+    static constexpr size_t MAX_CANDIDATES = 8 * TOP_K;
+    static constexpr size_t MIN_HISTORIES_PER_THREAD = 256;
+
+    // (otherBookId, number of patrons who borrowed both)
+    typedef vector<pair<int, int>> Row;
+    typedef unordered_map<int, Row> CountMatrix;
+
+    // bookId -> its strongest co-borrowed candidates
+    CountMatrix coCounts;
+    // bookId -> up to TOP_K co-borrowed book ids, most frequent first
+    unordered_map<int, vector<int>> topK;
+
+    // Add to one cell of a row. A full row evicts its weakest candidate and
+    // the newcomer inherits that count (the Space-Saving scheme): titles
+    // that are often co-borrowed stay in the row, at the price of counts
+    // overestimated by at most the evicted value.
+    static void bump(Row &row, int other, int by) {
+        for (auto &cell : row) {
+            if (cell.first == other) {
+                cell.second += by;
+                return;
+            }
+        }
+        if (row.size() < MAX_CANDIDATES) {
+            row.push_back({other, by});
+            return;
+        }
+        auto weakest = min_element(row.begin(), row.end(),
+                                   [](const pair<int, int> &a, const pair<int, int> &b) {
+                                       return a.second < b.second;
+                                   });
+        *weakest = {other, weakest->second + by};
+    }
+
+    // Count every pair of distinct books in one patron's history
+    static void countHistory(const vector<int> &history, CountMatrix &counts) {
+        vector<int> distinct(history);
+        sort(distinct.begin(), distinct.end());
+        distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+        for (size_t i = 0; i < distinct.size(); i++) {
+            for (size_t j = 0; j < distinct.size(); j++) {
+                if (i != j) {
+                    bump(counts[distinct[i]], distinct[j], 1);
+                }
+            }
+        }
+    }
+
+    // Select the TOP_K strongest neighbours of one row (ties by lower id)
+    static vector<int> selectTopK(const Row &row) {
+        vector<pair<int, int>> ranked(row.begin(), row.end());
+        auto stronger = [](const pair<int, int> &a, const pair<int, int> &b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        };
+        size_t k = min(TOP_K, ranked.size());
+        partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(), stronger);
+        vector<int> result;
+        for (size_t i = 0; i < k; i++) {
+            result.push_back(ranked[i].first);
+        }
+        return result;
+    }
+
+public:
+    // Recompute the whole matrix from scratch from count histories, where
+    // historyOf(i) returns the i-th one. Histories are split across worker
+    // threads that each count into a private matrix; the partial matrices
+    // are then merged and the top-k lists selected in parallel.
+    template <typename HistoryOf> void rebuild(size_t count, HistoryOf historyOf) {
+        size_t workers = parallelWorkers(count, MIN_HISTORIES_PER_THREAD);
+
+        vector<CountMatrix> partial(workers);
+        vector<thread> pool;
+        for (size_t w = 0; w < workers; w++) {
+            pool.emplace_back([&, w]() {
+                for (size_t i = w; i < count; i += workers) {
+                    countHistory(historyOf(i), partial[w]);
+                }
+            });
+        }
+        for (auto &t : pool) {
+            t.join();
+        }
+        pool.clear();
+
+        coCounts = move(partial[0]);
+        for (size_t w = 1; w < workers; w++) {
+            for (auto &row : partial[w]) {
+                auto &dest = coCounts[row.first];
+                for (auto &cell : row.second) {
+                    bump(dest, cell.first, cell.second);
+                }
+            }
+        }
+
+        vector<int> titles;
+        for (auto &row : coCounts) {
+            titles.push_back(row.first);
+        }
+        vector<vector<int>> lists(titles.size());
+        for (size_t w = 0; w < workers; w++) {
+            pool.emplace_back([&, w]() {
+                for (size_t i = w; i < titles.size(); i += workers) {
+                    lists[i] = selectTopK(coCounts.at(titles[i]));
+                }
+            });
+        }
+        for (auto &t : pool) {
+            t.join();
+        }
+
+        topK.clear();
+        for (size_t i = 0; i < titles.size(); i++) {
+            topK[titles[i]] = move(lists[i]);
+        }
+    }
+
+    // Fold one newly returned book into the matrix. priorHistory is the
+    // patron's history before this return; only the rows that changed
+    // have their top-k lists refreshed.
+    void recordReturn(const vector<int> &priorHistory, int bookId) {
+        if (find(priorHistory.begin(), priorHistory.end(), bookId) !=
+            priorHistory.end()) {
+            // Pairs with this book were already counted for this patron
+            return;
+        }
+        vector<int> distinct(priorHistory);
+        sort(distinct.begin(), distinct.end());
+        distinct.erase(unique(distinct.begin(), distinct.end()), distinct.end());
+        for (int other : distinct) {
+            bump(coCounts[bookId], other, 1);
+            bump(coCounts[other], bookId, 1);
+            topK[other] = selectTopK(coCounts[other]);
+        }
+        if (!distinct.empty()) {
+            topK[bookId] = selectTopK(coCounts[bookId]);
+        }
+    }
+
+    // Books most often co-borrowed with bookId (empty if none)
+    const vector<int> &recommend(int bookId) const {
+        static const vector<int> none;
+        auto it = topK.find(bookId);
+        return it != topK.end() ? it->second : none;
+    }
+};
+
+// --------------------
+// CirculationLog Class
+// --------------------
+// Kinds of circulation event recorded in the log
+enum EventType : uint8_t { EV_BORROW, EV_RETURN, EV_FINE, EV_PAY };
+
+// Append-only, columnar store of timestamped circulation events. Each column
+// lives in its own fixed-width binary file (<base>.ts, <base>.type, ...), so
+// appending is a handful of small writes and a query only touches the
+// columns it needs. The report memory-maps the column files and reads them
+// in a single pass, one contiguous slice per thread.
+class CirculationLog {
+private:
+    static constexpr int64_t SECONDS_PER_DAY = 60 * 60 * 24;
+    static constexpr int64_t SECONDS_PER_WEEK = SECONDS_PER_DAY * 7;
+    static constexpr size_t MIN_EVENTS_PER_THREAD = 1 << 16;
+    static constexpr int64_t MAX_REPORT_WEEKS = 52 * 50;
+
+    string base;
+    ofstream tsOut, typeOut, userOut, bookOut, valueOut;
+
+    // Read-only memory mapping of one column file
+    struct MappedColumn {
+        void *addr = nullptr;
+        size_t bytes = 0;
+
+        explicit MappedColumn(const string &path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return;
+            }
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    addr = p;
+                    bytes = st.st_size;
+                }
+            }
+            ::close(fd);
+        }
+        ~MappedColumn() {
+            if (addr) {
+                munmap(addr, bytes);
+            }
+        }
+        MappedColumn(const MappedColumn &) = delete;
+        MappedColumn &operator=(const MappedColumn &) = delete;
+
+        template <typename T> const T *as() const {
+            return static_cast<const T *>(addr);
+        }
+        template <typename T> size_t rows() const { return bytes / sizeof(T); }
+    };
+
+    string columnPath(const char *suffix) const { return base + "." + suffix; }
+
+    // Run fn(worker, begin, end) over one contiguous slice of [0, rows)
+    // per worker thread
+    template <typename Fn>
+    static void parallelSlices(size_t rows, size_t workers, Fn fn) {
+        vector<thread> pool;
+        size_t chunk = (rows + workers - 1) / workers;
+        for (size_t w = 0; w < workers; w++) {
+            size_t begin = min(rows, w * chunk);
+            size_t end = min(rows, begin + chunk);
+            pool.emplace_back(fn, w, begin, end);
+        }
+        for (auto &t : pool) {
+            t.join();
+        }
+    }
+
+    template <typename T>
+    static void writeValue(ofstream &out, T value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+        out.flush();
+    }
+
+public:
+    // Open (creating if needed) the column files under the given base name.
+    // A crash mid-append can leave the columns with different lengths, so
+    // every column is cut back to the shortest one first. If only some of
+    // the columns exist the log is damaged; it is left untouched and no
+    // events are recorded.
+    bool open(const string &baseName) {
+        const pair<const char *, size_t> columns[] = {
+            {"ts", sizeof(int64_t)}, {"type", sizeof(uint8_t)},
+            {"user", sizeof(int32_t)}, {"book", sizeof(int32_t)},
+            {"value", sizeof(double)}};
+        uintmax_t rows = UINTMAX_MAX;
+        size_t present = 0;
+        string missing;
+        for (auto &col : columns) {
+            error_code ec;
+            uintmax_t bytes = filesystem::file_size(baseName + "." + col.first, ec);
+            if (ec) {
+                missing = baseName + "." + col.first;
+                continue;
+            }
+            present++;
+            rows = min<uintmax_t>(rows, bytes / col.second);
+        }
+        if (present > 0 && !missing.empty()) {
+            cout << "Circulation log column " << missing
+                 << " is missing; events will not be recorded.\n";
+            return false;
+        }
+        base = baseName;
+        if (present > 0) {
+            for (auto &col : columns) {
+                error_code ec;
+                filesystem::resize_file(columnPath(col.first), rows * col.second, ec);
+            }
+        }
+        tsOut.open(columnPath("ts"), ios::binary | ios::app);
+        typeOut.open(columnPath("type"), ios::binary | ios::app);
+        userOut.open(columnPath("user"), ios::binary | ios::app);
+        bookOut.open(columnPath("book"), ios::binary | ios::app);
+        valueOut.open(columnPath("value"), ios::binary | ios::app);
+        return true;
+    }
+
+    // Number of events in the log
+    size_t size() const {
+        if (base.empty()) {
+            return 0;
+        }
+        error_code ec;
+        uintmax_t bytes = filesystem::file_size(columnPath("type"), ec);
+        return ec ? 0 : bytes;
+    }
+
+    // value: loan length in days for returns, rupees for fines/payments
+    void append(EventType type, int userId, int bookId, double value) {
+        if (base.empty()) {
+            return;
+        }
+        writeValue<int64_t>(tsOut, static_cast<int64_t>(time(nullptr)));
+        writeValue<uint8_t>(typeOut, type);
+        writeValue<int32_t>(userOut, userId);
+        writeValue<int32_t>(bookOut, bookId);
+        writeValue<double>(valueOut, value);
+    }
+
+    // Results of one circulation report over the whole log
+    struct Report {
+        // (bookId, borrowCount) pairs since the cutoff, most borrowed first
+        vector<pair<int, long long>> topBorrowed;
+        // Mean loan length in days over returns since the cutoff (0 if none)
+        double averageLoanDays = 0;
+        // Fine payments collected per week: weekStartTime -> rupees
+        map<int64_t, double> finesPerWeek;
+    };
+
+    // Build every report figure in a single pass over the log: each thread
+    // reads its slice of the ts/type/book/value columns once and keeps its
+    // own borrow histogram, loan totals and weekly payment bins, which are
+    // merged afterwards. Borrowed book ids outside [1, maxBookId] are ignored.
+    Report report(int64_t since, size_t k, int32_t maxBookId) const {
+        Report result;
+        if (base.empty()) {
+            return result;
+        }
+        MappedColumn ts(columnPath("ts")), type(columnPath("type")),
+            book(columnPath("book")), value(columnPath("value"));
+        size_t rows = min({ts.rows<int64_t>(), type.rows<uint8_t>(),
+                           book.rows<int32_t>(), value.rows<double>()});
+        if (rows == 0) {
+            return result;
+        }
+        const int64_t *tsCol = ts.as<int64_t>();
+        const uint8_t *typeCol = type.as<uint8_t>();
+        const int32_t *bookCol = book.as<int32_t>();
+        const double *valueCol = value.as<double>();
+
+        // The log is appended in time order, so the first and last rows
+        // bound the range of weeks. A damaged timestamp must not blow up the
+        // histogram, so the range ends no later than now and spans at most
+        // MAX_REPORT_WEEKS; events outside it land in the edge bins.
+        int64_t nowWeek = static_cast<int64_t>(time(nullptr)) / SECONDS_PER_WEEK;
+        int64_t lastWeek = min(tsCol[rows - 1] / SECONDS_PER_WEEK, nowWeek);
+        int64_t firstWeek = max(min(tsCol[0] / SECONDS_PER_WEEK, lastWeek),
+                                lastWeek - MAX_REPORT_WEEKS + 1);
+        size_t span = static_cast<size_t>(max<int64_t>(lastWeek - firstWeek, 0)) + 1;
+
+        // Book ids are small and dense, so borrows are counted into a flat
+        // histogram indexed by id, sized by the catalog rather than by
+        // whatever ids the file contains
+        uint32_t maxId = static_cast<uint32_t>(max<int32_t>(maxBookId, 0));
+        struct Partial {
+            vector<long long> borrows;
+            double loanDays = 0;
+            long long returns = 0;
+            vector<double> weeks;
+        };
+        size_t workers = parallelWorkers(rows, MIN_EVENTS_PER_THREAD);
+        vector<Partial> partial(workers);
+        parallelSlices(rows, workers, [&](size_t w, size_t begin, size_t end) {
+            Partial &part = partial[w];
+            part.borrows.assign(maxId + 1, 0);
+            part.weeks.assign(span, 0);
+            for (size_t i = begin; i < end; i++) {
+                int64_t t = tsCol[i];
+                switch (typeCol[i]) {
+                case EV_BORROW: {
+                    uint32_t id = static_cast<uint32_t>(bookCol[i]);
+                    if (t >= since && id >= 1 && id <= maxId) {
+                        part.borrows[id]++;
+                    }
+                    break;
+                }
+                case EV_RETURN:
+                    if (t >= since) {
+                        part.loanDays += valueCol[i];
+                        part.returns++;
+                    }
+                    break;
+                case EV_PAY: {
+                    int64_t week = t / SECONDS_PER_WEEK - firstWeek;
+                    week = min<int64_t>(max<int64_t>(week, 0), span - 1);
+                    part.weeks[week] += valueCol[i];
+                    break;
+                }
+                default:
+                    break;
+                }
+            }
+        });
+
+        long long returns = 0;
+        for (auto &part : partial) {
+            result.averageLoanDays += part.loanDays;
+            returns += part.returns;
+        }
+        result.averageLoanDays = returns > 0 ? result.averageLoanDays / returns : 0;
+
+        for (size_t b = 0; b < span; b++) {
+            double total = 0;
+            for (auto &part : partial) {
+                total += part.weeks[b];
+            }
+            if (total > 0) {
+                result.finesPerWeek[(firstWeek + b) * SECONDS_PER_WEEK] = total;
+            }
+        }
+
+        auto &ranked = result.topBorrowed;
+        for (uint32_t id = 1; id <= maxId; id++) {
+            long long total = 0;
+            for (auto &part : partial) {
+                total += part.borrows[id];
+            }
+            if (total > 0) {
+                ranked.push_back({id, total});
+            }
+        }
+        k = min(k, ranked.size());
+        partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(),
+                     [](const pair<int, long long> &a, const pair<int, long long> &b) {
+                         return a.second != b.second ? a.second > b.second
+                                                     : a.first < b.first;
+                     });
+        ranked.resize(k);
+        return result;
+    }
+};
+
+// --------------------
+// PersistenceWriter Class
+// --------------------
+// How often appended records are forced to disk
+enum DurabilityMode {
+    DURABLE_PER_OP,  // fsync after every record
+    DURABLE_BATCHED  // group commit: one write + fsync per drained batch
+};
+
+// Appends serialized mutations to a segment file from a dedicated I/O
+// thread, so disk latency never lands on the thread serving patrons.
+// Producers hand records over through a bounded lock-free multi-producer /
+// single-consumer ring; when the ring is full they wait (backpressure)
+// rather than grow memory without bound.
+class PersistenceWriter {
+private:
+    static constexpr size_t QUEUE_CAPACITY = 1024; // must be a power of two
+    static constexpr size_t MAX_BATCH_BYTES = 1 << 20;
+    static constexpr size_t DISK_BLOCK = 4096;
+
+    // Ring slot: sequence == position means free for that producer,
+    // position + 1 means filled and ready for the consumer
+    struct Slot {
+        atomic<size_t> sequence;
+        string record;
+    };
+
+    unique_ptr<Slot[]> slots;
+    atomic<size_t> enqueuePos{0};
+    size_t dequeuePos = 0; // only touched by the I/O thread
+
+    int fd = -1;
+    size_t fileOffset = 0;
+    DurabilityMode mode = DURABLE_BATCHED;
+    thread worker;
+    atomic<bool> stopping{false};
+    // Set once a write or fsync fails; nothing after that is durable
+    atomic<bool> failed{false};
+
+    // Wakes the I/O thread, and wakes flush() callers once records are durable
+    mutex signalLock;
+    condition_variable workAvailable;
+    condition_variable durable;
+    atomic<uint64_t> submittedOps{0};
+    atomic<uint64_t> durableOps{0};
+
+    // Statistics
+    atomic<uint64_t> logicalBytes{0};
+    atomic<uint64_t> blockBytes{0};
+    atomic<uint64_t> fsyncCount{0};
+    atomic<uint64_t> backpressureWaits{0};
+    chrono::steady_clock::time_point startTime;
+
+    // On success, ticket is the durableOps value at which the record is on disk
+    bool tryEnqueue(string &record, uint64_t &ticket) {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        while (true) {
+            Slot &slot = slots[pos & (QUEUE_CAPACITY - 1)];
+            size_t seq = slot.sequence.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                                     memory_order_relaxed)) {
+                    slot.record = move(record);
+                    slot.sequence.store(pos + 1, memory_order_release);
+                    ticket = pos + 1;
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool hasRecord() const {
+        const Slot &slot = slots[dequeuePos & (QUEUE_CAPACITY - 1)];
+        return slot.sequence.load(memory_order_acquire) == dequeuePos + 1;
+    }
+
+    bool tryDequeue(string &record) {
+        Slot &slot = slots[dequeuePos & (QUEUE_CAPACITY - 1)];
+        if (slot.sequence.load(memory_order_acquire) != dequeuePos + 1) {
+            return false; // empty, or a producer is still filling the slot
+        }
+        record = move(slot.record);
+        slot.record.clear();
+        slot.sequence.store(dequeuePos + QUEUE_CAPACITY, memory_order_release);
+        dequeuePos++;
+        return true;
+    }
+
+    // Write one buffer at the end of the file and optionally fsync it
+    bool commit(const string &buffer, bool sync) {
+        if (failed.load()) {
+            return false;
+        }
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                cerr << "Segment write failed: " << strerror(errno) << "\n";
+                failed = true;
+                return false;
+            }
+            written += n;
+        }
+        // The device rewrites every block the append touches, so a small
+        // record still costs a whole block
+        size_t firstBlock = fileOffset / DISK_BLOCK;
+        size_t lastBlock = (fileOffset + buffer.size() + DISK_BLOCK - 1) / DISK_BLOCK;
+        blockBytes += (lastBlock - firstBlock) * DISK_BLOCK;
+        fileOffset += buffer.size();
+        if (sync) {
+            fsyncCount++;
+            if (::fsync(fd) != 0) {
+                cerr << "Segment fsync failed: " << strerror(errno) << "\n";
+                failed = true;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Publish how many records are now on disk and wake anyone waiting
+    void markDurable(uint64_t count, bool ok) {
+        lock_guard<mutex> guard(signalLock);
+        if (ok) {
+            durableOps += count;
+        }
+        durable.notify_all();
+    }
+
+    // Wake the I/O thread. Taking the lock first means the wakeup cannot
+    // slip in between its check for work and its wait.
+    void wakeWriter() {
+        { lock_guard<mutex> guard(signalLock); }
+        workAvailable.notify_one();
+    }
+
+    void run() {
+        string batch, record;
+        while (true) {
+            batch.clear();
+            uint64_t drained = 0;
+            while (batch.size() < MAX_BATCH_BYTES && tryDequeue(record)) {
+                drained++;
+                if (mode == DURABLE_PER_OP) {
+                    markDurable(1, commit(record, true));
+                } else {
+                    batch += record;
+                }
+            }
+            if (!batch.empty()) {
+                markDurable(drained, commit(batch, true));
+            }
+            if (drained > 0) {
+                continue;
+            }
+            if (stopping.load() && enqueuePos.load() == dequeuePos) {
+                return;
+            }
+            // Sleep until a record is ready; producers signal under the lock
+            unique_lock<mutex> guard(signalLock);
+            workAvailable.wait(guard, [&]() { return hasRecord() || stopping.load(); });
+        }
+    }
+
+public:
+    PersistenceWriter() : slots(new Slot[QUEUE_CAPACITY]) {
+        for (size_t i = 0; i < QUEUE_CAPACITY; i++) {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+    ~PersistenceWriter() { stop(); }
+    PersistenceWriter(const PersistenceWriter &) = delete;
+    PersistenceWriter &operator=(const PersistenceWriter &) = delete;
+
+    // Open the file for appending and start the I/O thread
+    bool start(const string &path, DurabilityMode durability) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            cerr << "Cannot open segment " << path << ": " << strerror(errno)
+                 << "\n";
+            return false;
+        }
+        struct stat st;
+        fileOffset = fstat(fd, &st) == 0 ? st.st_size : 0;
+        mode = durability;
+        startTime = chrono::steady_clock::now();
+        stopping = false;
+        failed = false;
+        worker = thread(&PersistenceWriter::run, this);
+        return true;
+    }
+
+    bool isRunning() const { return worker.joinable(); }
+
+    // Queue one serialized mutation; blocks while the queue is full. In
+    // per-op mode it also waits until the record is on disk. Returns false
+    // if the writer is not running or the record could not be made durable.
+    bool submit(string record) {
+        if (!isRunning() || failed.load()) {
+            return false;
+        }
+        logicalBytes += record.size();
+        uint64_t ticket = 0;
+        while (!tryEnqueue(record, ticket)) {
+            backpressureWaits++;
+            wakeWriter();
+            this_thread::yield();
+        }
+        submittedOps++;
+        wakeWriter();
+        if (mode != DURABLE_PER_OP) {
+            return true;
+        }
+        unique_lock<mutex> guard(signalLock);
+        durable.wait(guard, [&]() {
+            return durableOps.load() >= ticket || failed.load();
+        });
+        return durableOps.load() >= ticket;
+    }
+
+    // Wait until everything submitted so far is on disk. Returns false if
+    // the writer is not running or a write or fsync failed.
+    bool flush() {
+        if (!isRunning()) {
+            return false;
+        }
+        uint64_t target = submittedOps.load();
+        wakeWriter();
+        unique_lock<mutex> guard(signalLock);
+        durable.wait(guard, [&]() {
+            return durableOps.load() >= target || failed.load();
+        });
+        return durableOps.load() >= target;
+    }
+
+    // Drain the queue, then stop the I/O thread and close the file
+    void stop() {
+        if (!isRunning()) {
+            return;
+        }
+        stopping = true;
+        wakeWriter();
+        worker.join();
+        ::close(fd);
+        fd = -1;
+    }
+
+    uint64_t getRecordCount() const { return submittedOps.load(); }
+
+    // A write or fsync failed; records submitted since are not on disk
+    bool hasFailed() const { return failed.load(); }
+
+    void printStats(const string &label) const {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() -
+                                                  startTime).count();
+        ostringstream rate, amplification;
+        rate << fixed << setprecision(2)
+             << (seconds > 0 ? fsyncCount.load() / seconds : 0);
+        amplification << fixed << setprecision(2)
+                      << (logicalBytes.load() > 0
+                              ? static_cast<double>(blockBytes.load()) /
+                                    logicalBytes.load()
+                              : 0);
+        cout << label << ": " << submittedOps.load() << " record(s), "
+             << logicalBytes.load() << " bytes, " << fsyncCount.load()
+             << " fsync(s) (" << rate.str() << "/s), write amplification "
+             << amplification.str() << "x, " << backpressureWaits.load()
+             << " backpressure wait(s)";
+        if (failed.load()) {
+            cout << ", FAILED";
+        }
+        cout << "\n";
+    }
+};
+
 // Forward declare Library
 class Library;
 
@@ -224,10 +1350,12 @@ protected:
     int id;
     string name;
     Account account;
+    // Not yet written to disk
+    bool dirty;
 
 public:
-    User() : id(0) {}
-    User(int _id, const string &_name) : id(_id), name(_name) {}
+    User() : id(0), dirty(true) {}
+    User(int _id, const string &_name) : id(_id), name(_name), dirty(true) {}
     virtual ~User() {}
 
     int getId() const { return id; }
@@ -235,6 +1363,12 @@ public:
 
     Account &getAccount() { return account; }
 
+    bool isDirty() const { return dirty || account.isDirty(); }
+    void clearDirty() {
+        dirty = false;
+        account.clearDirty();
+    }
+
     // Must be overridden for Student/Faculty/Librarian
     virtual void borrowBook(Library &lib, int bookId, int currentDay) = 0;
     virtual void returnBook(Library &lib, int bookId, int currentDay) = 0;
@@ -273,92 +1407,906 @@ public:
     int getBorrowPeriod() const { return BORROW_PERIOD; }
     double getFineRate() const { return FINE_RATE; }
 
-    virtual string getType() const override { return "Student"; }
+    virtual string getType() const override { return "Student"; }
+
+    virtual void displayDetails() const override {
+        cout << "Role: Student\n";
+        User::displayDetails();
+        account.printAccount();
+    }
+};
+
+// Define the static member
+const double Student::FINE_RATE = 10.0;
+
+// --------------------
+// Faculty Class
+// --------------------
+class Faculty : public User {
+private:
+    static const int BORROW_LIMIT = 5;
+    static const int BORROW_PERIOD = 30;
+
+public:
+    Faculty(int _id, const string &_name) : User(_id, _name) {}
+
+    virtual void borrowBook(Library &lib, int bookId, int currentDay) override;
+    virtual void returnBook(Library &lib, int bookId, int currentDay) override;
+
+    int getBorrowLimit() const { return BORROW_LIMIT; }
+    int getBorrowPeriod() const { return BORROW_PERIOD; }
+
+    virtual string getType() const override { return "Faculty"; }
+
+    virtual void displayDetails() const override {
+        cout << "Role: Faculty\n";
+        User::displayDetails();
+        account.printAccount();
+    }
+};
+
+// --------------------
+// Librarian Class
+// --------------------
+class Librarian : public User {
+public:
+    Librarian(int _id, const string &_name) : User(_id, _name) {}
+
+    virtual void borrowBook(Library &, int, int) override {
+        cout << "Librarian accounts cannot borrow books." << endl;
+    }
+
+    virtual void returnBook(Library &, int, int) override {
+        cout << "Librarian accounts cannot return books." << endl;
+    }
+
+    virtual string getType() const override { return "Librarian"; }
+
+    virtual void displayDetails() const override {
+        cout << "Role: Librarian\n";
+        User::displayDetails();
+    }
+};
+
+// --------------------
+// Branch Class
+// --------------------
+// One branch library's share of the catalog and patrons. Each branch has
+// its own data files and segment, and loads and saves independently of
+// the others; the Library routes requests to the right branch.
+class Branch {
+private:
+    string booksFile;
+    string usersFile;
+    string segmentFile;
+    // Leave cold fields on disk until first accessed
+    bool lazy;
+
+    vector<Book> books;
+    vector<User *> users;
+    // Id lookups: bookId -> position in books, userId -> position in users
+    unordered_map<int, size_t> bookIndex;
+    unordered_map<int, size_t> userIndex;
+    PersistenceWriter segment;
+
+    // Records handed out for possible modification. Books are looked up
+    // afresh for every operation, so their set is reset by each save; the
+    // logged-in user is held across saves, so users stay in theirs.
+    set<int> touchedBooks;
+    set<int> touchedUsers;
+    // Records removed since the last saveChanges()
+    vector<int> removedBooks;
+    vector<int> removedUsers;
+
+    Book *lookupBook(int bookId) {
+        auto it = bookIndex.find(bookId);
+        return it != bookIndex.end() ? &books[it->second] : nullptr;
+    }
+
+    const Book *lookupBook(int bookId) const {
+        auto it = bookIndex.find(bookId);
+        return it != bookIndex.end() ? &books[it->second] : nullptr;
+    }
+
+    User *lookupUser(int userId) {
+        auto it = userIndex.find(userId);
+        return it != userIndex.end() ? users[it->second] : nullptr;
+    }
+
+    // Rebuild the book positions after books were erased or reloaded
+    void reindexBooks() {
+        bookIndex.clear();
+        for (size_t i = 0; i < books.size(); i++) {
+            bookIndex[books[i].getId()] = i;
+        }
+    }
+
+    // Erase every book matching the predicate, keeping catalog order
+    template <typename Pred> size_t eraseBooks(Pred pred) {
+        auto it = remove_if(books.begin(), books.end(), pred);
+        size_t erased = books.end() - it;
+        if (erased > 0) {
+            books.erase(it, books.end());
+            reindexBooks();
+        }
+        return erased;
+    }
+
+    void appendBook(const Book &b) {
+        bookIndex[b.getId()] = books.size();
+        books.push_back(b);
+    }
+
+    // Location of a record for lazy loading; NOWHERE when loading eagerly
+    int64_t locate(int source, streamoff offset) const {
+        return lazy ? RecordStore::handle(source, offset) : RecordStore::NOWHERE;
+    }
+
+    static Book parseBook(const string &record, int64_t where) {
+        return where != RecordStore::NOWHERE ? Book::deserializeHot(record, where)
+                                             : Book::deserialize(record);
+    }
+
+    // Rebuild a user from one line of the users file / segment. With a
+    // valid location, the account history is left on disk.
+    static User *parseUser(const string &line, int64_t where) {
+        istringstream iss(line);
+        string type, idStr, nm, accData;
+        getline(iss, type, ',');
+        getline(iss, idStr, ',');
+        getline(iss, nm, ',');
+        getline(iss, accData);
+
+        // Parse everything that can throw before allocating the user
+        int userId = stoi(idStr);
+        Account account = where != RecordStore::NOWHERE
+                              ? Account::deserializeHot(accData, where)
+                              : Account::deserialize(accData);
+        User *user = nullptr;
+
+        if (type == "Student") {
+            user = new Student(userId, nm);
+        } else if (type == "Faculty") {
+            user = new Faculty(userId, nm);
+        } else if (type == "Librarian") {
+            user = new Librarian(userId, nm);
+        }
+
+        if (user) {
+            user->getAccount() = account;
+            user->clearDirty();
+        }
+        return user;
+    }
+
+    // Insert or replace a user with the same id. Only for loading, where a
+    // later record supersedes an earlier one; new users go through addUser.
+    void upsertUser(User *user) {
+        auto it = userIndex.find(user->getId());
+        if (it != userIndex.end()) {
+            delete users[it->second];
+            users[it->second] = user;
+        } else {
+            userIndex[user->getId()] = users.size();
+            users.push_back(user);
+        }
+    }
+
+    // Remove and free a user; false if there is none with that id
+    bool eraseUser(int userId) {
+        auto it = userIndex.find(userId);
+        if (it == userIndex.end()) {
+            return false;
+        }
+        delete users[it->second];
+        users.erase(users.begin() + it->second);
+        userIndex.clear();
+        for (size_t i = 0; i < users.size(); i++) {
+            userIndex[users[i]->getId()] = i;
+        }
+        return true;
+    }
+
+    // Serialize and queue one record; false if its cold fields could not
+    // be read or the writer did not accept it
+    template <typename Serialize> bool submitRecord(Serialize serialize) {
+        string record;
+        try {
+            record = serialize();
+        } catch (const exception &e) {
+            cerr << e.what() << "\n";
+            return false;
+        }
+        return segment.submit(withChecksum(record) + "\n");
+    }
+
+public:
+    // Guards the branch against concurrent fan-out searches and transfers
+    mutable mutex lock;
+
+    Branch(const string &_booksFile, const string &_usersFile,
+           const string &_segmentFile, bool _lazy)
+        : booksFile(_booksFile), usersFile(_usersFile),
+          segmentFile(_segmentFile), lazy(_lazy) {}
+    ~Branch() {
+        for (auto *u : users) {
+            delete u;
+        }
+    }
+    Branch(const Branch &) = delete;
+    Branch &operator=(const Branch &) = delete;
+
+    void addBook(const Book &b) {
+        appendBook(b);
+        // New to this branch, so it must be saved even if the copy was clean
+        books.back().markDirty();
+        touchedBooks.insert(b.getId());
+    }
+
+    bool removeBook(int bookId) {
+        if (eraseBooks([bookId](const Book &bk) { return bk.getId() == bookId; }) ==
+            0) {
+            return false;
+        }
+        touchedBooks.erase(bookId);
+        removedBooks.push_back(bookId);
+        return true;
+    }
+
+    int getHighestBookId() const {
+        int highest = 0;
+        for (auto &bk : books) {
+            if (bk.getId() > highest) {
+                highest = bk.getId();
+            }
+        }
+        return highest;
+    }
+
+    Book *findBook(int bookId) {
+        Book *bk = lookupBook(bookId);
+        if (bk) {
+            touchedBooks.insert(bookId);
+        }
+        return bk;
+    }
+
+    // Read-only lookup; does not mark the book as possibly modified
+    const Book *peekBook(int bookId) const {
+        return lookupBook(bookId);
+    }
+
+    // Available books whose title contains the query
+    vector<Book> searchAvailable(const string &query) const {
+        lock_guard<mutex> guard(lock);
+        vector<Book> matches;
+        for (auto &bk : books) {
+            if (bk.getStatus() == AVAILABLE &&
+                bk.peekTitle().find(query) != string::npos) {
+                matches.push_back(bk);
+            }
+        }
+        return matches;
+    }
+
+    const vector<User *> &getUsers() const { return users; }
+
+    // Takes ownership of the user; false (and the user is freed) if the
+    // id is already taken
+    bool addUser(User *user) {
+        if (lookupUser(user->getId())) {
+            delete user;
+            return false;
+        }
+        upsertUser(user);
+        touchedUsers.insert(user->getId());
+        return true;
+    }
+
+    User *findUser(int userId) {
+        User *u = lookupUser(userId);
+        if (u) {
+            touchedUsers.insert(userId);
+        }
+        return u;
+    }
+
+    bool removeUser(int userId) {
+        if (!eraseUser(userId)) {
+            return false;
+        }
+        touchedUsers.erase(userId);
+        removedUsers.push_back(userId);
+        return true;
+    }
+
+    // Append every record changed since the last call to the segment file.
+    // The cost is proportional to the number of changes, not the catalog.
+    // Records the writer did not accept stay dirty, so the next save or
+    // merge still has them. Returns false if any record was not accepted.
+    bool saveChanges() {
+        bool ok = true;
+        set<int> unsaved;
+        for (int bookId : touchedBooks) {
+            Book *bk = lookupBook(bookId);
+            if (bk && bk->isDirty()) {
+                if (submitRecord([bk]() { return "B," + bk->serialize(); })) {
+                    bk->clearDirty();
+                } else {
+                    unsaved.insert(bookId);
+                    ok = false;
+                }
+            }
+        }
+        touchedBooks.swap(unsaved);
+        for (int userId : touchedUsers) {
+            User *u = lookupUser(userId);
+            if (u && u->isDirty()) {
+                if (submitRecord([u]() {
+                        return "U," + u->getType() + "," + u->serialize();
+                    })) {
+                    u->clearDirty();
+                } else {
+                    ok = false;
+                }
+            }
+        }
+        vector<int> unsavedRemovals;
+        for (int bookId : removedBooks) {
+            if (!segment.submit(withChecksum("XB," + to_string(bookId)) + "\n")) {
+                unsavedRemovals.push_back(bookId);
+                ok = false;
+            }
+        }
+        removedBooks.swap(unsavedRemovals);
+        unsavedRemovals.clear();
+        for (int userId : removedUsers) {
+            if (!segment.submit(withChecksum("XU," + to_string(userId)) + "\n")) {
+                unsavedRemovals.push_back(userId);
+                ok = false;
+            }
+        }
+        removedUsers.swap(unsavedRemovals);
+        return ok;
+    }
+
+    // Changes the segment does not hold: records or removals it did not
+    // accept, or anything after its writer failed
+    bool hasUnsavedChanges() const {
+        if (segment.hasFailed() || !removedBooks.empty() || !removedUsers.empty()) {
+            return true;
+        }
+        for (int bookId : touchedBooks) {
+            const Book *bk = lookupBook(bookId);
+            if (bk && bk->isDirty()) {
+                return true;
+            }
+        }
+        for (int userId : touchedUsers) {
+            auto it = userIndex.find(userId);
+            if (it != userIndex.end() && users[it->second]->isDirty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Re-apply changes saved to the segment since the last merge. The
+    // segment is append-only, so only a torn tail can be damaged: replay
+    // stops at the first record that fails its checksum, lacks its newline
+    // or does not parse, and the file is cut back to the last good record.
+    void replaySegment() {
+        const string &filename = segmentFile;
+        ifstream fin(filename);
+        int source = RecordStore::open(filename, true);
+        string line, record;
+        streamoff goodBytes = 0;
+        bool damaged = false;
+        while (getline(fin, line)) {
+            if (fin.eof() || !verifyChecksum(line, record)) {
+                damaged = true;
+                break;
+            }
+            streamoff offset = goodBytes;
+            try {
+                applySegmentRecord(record, source, offset);
+            } catch (const exception &) { // invalid_argument / out_of_range
+                damaged = true;
+                break;
+            }
+            goodBytes += line.size() + 1;
+        }
+        fin.close();
+        if (damaged) {
+            cout << "Damaged record in " << filename
+                 << "; discarding the rest of it.\n";
+            error_code ec;
+            filesystem::resize_file(filename, goodBytes, ec);
+        }
+    }
+
+    // Apply one segment record; throws if its fields do not parse
+    void applySegmentRecord(const string &record, int source, streamoff offset) {
+        size_t comma = record.find(',');
+        if (comma == string::npos) {
+            return;
+        }
+        string kind = record.substr(0, comma);
+        string payload = record.substr(comma + 1);
+        if (kind == "B") {
+            Book b = parseBook(payload, locate(source, offset));
+            Book *existing = lookupBook(b.getId());
+            if (existing) {
+                *existing = b;
+            } else {
+                appendBook(b);
+            }
+        } else if (kind == "U") {
+            User *user = parseUser(payload, locate(source, offset));
+            if (user) {
+                upsertUser(user);
+            }
+        } else if (kind == "XB") {
+            int bookId = stoi(payload);
+            eraseBooks([bookId](const Book &bk) { return bk.getId() == bookId; });
+        } else if (kind == "XU") {
+            eraseUser(stoi(payload));
+        }
+    }
+
+    // Start appending saved changes to the segment file; false if it
+    // cannot be opened
+    bool openSegment(DurabilityMode mode) {
+        return segment.start(segmentFile, mode);
+    }
+
+    // Wait until everything saved so far is on disk; false if it is not
+    bool flushSegment() {
+        return segment.flush();
+    }
+
+    // Stop the segment writer once everything queued is on disk
+    void closeSegment(const string &label, bool quietIfIdle) {
+        segment.stop();
+        if (!quietIfIdle || segment.getRecordCount() > 0) {
+            segment.printStats(label);
+        }
+    }
+
+    // Once the segment outgrows the data files, fold it back into them:
+    // each data file is rewritten atomically, then the segment is emptied.
+    // Replaying a segment over already-merged files is harmless, so a crash
+    // at any point leaves a loadable state. Must not run while the segment
+    // writer is active. With force, the data files are rewritten whatever
+    // the sizes, for changes the segment could not take. Returns false if
+    // a required rewrite failed.
+    bool mergeSegment(bool force = false) {
+        if (!force) {
+            error_code ec;
+            uintmax_t segmentBytes = filesystem::file_size(segmentFile, ec);
+            if (ec || segmentBytes == 0) {
+                return true;
+            }
+            uintmax_t booksBytes = filesystem::file_size(booksFile, ec);
+            booksBytes = ec ? 0 : booksBytes;
+            uintmax_t usersBytes = filesystem::file_size(usersFile, ec);
+            usersBytes = ec ? 0 : usersBytes;
+            if (segmentBytes < booksBytes + usersBytes) {
+                return true;
+            }
+        }
+        if (!saveBooks() || !saveUsers() ||
+            !replaceFileAtomically(segmentFile, "")) {
+            return false;
+        }
+        RecordStore::open(segmentFile, true);
+        removedBooks.clear();
+        removedUsers.clear();
+        return true;
+    }
+
+    void displayBooks() const {
+        for (auto &bk : books) {
+            bk.printDetails();
+        }
+    }
+
+    void displayUsers() const {
+        for (auto &u : users) {
+            u->displayDetails();
+            cout << "------------------------\n";
+        }
+    }
+
+    // Load this branch's data files and segment. Returns false if the
+    // branch has no data files yet.
+    bool load() {
+        bool found = loadBooks();
+        found = loadUsers() && found;
+        replaySegment();
+        mergeSegment();
+        return found;
+    }
 
-    virtual void displayDetails() const override {
-        cout << "Role: Student\n";
-        User::displayDetails();
-        account.printAccount();
+    vector<int> getBookIds() const {
+        vector<int> ids;
+        for (auto &bk : books) {
+            ids.push_back(bk.getId());
+        }
+        return ids;
     }
-};
 
-// Define the static member
-const double Student::FINE_RATE = 10.0;
+    // Hand every record over to the caller, leaving the branch empty
+    void releaseAll(vector<Book> &outBooks, vector<User *> &outUsers) {
+        outBooks.swap(books);
+        outUsers.swap(users);
+        books.clear();
+        users.clear();
+        bookIndex.clear();
+        userIndex.clear();
+        touchedBooks.clear();
+        touchedUsers.clear();
+    }
 
-// --------------------
-// Faculty Class
-// --------------------
-class Faculty : public User {
-private:
-    static const int BORROW_LIMIT = 5;
-    static const int BORROW_PERIOD = 30;
+    // Write every record to fresh data files and empty the segment, for
+    // records moved in wholesale rather than saved change by change
+    bool saveAll() {
+        return saveBooks() && saveUsers() &&
+               replaceFileAtomically(segmentFile, "");
+    }
 
-public:
-    Faculty(int _id, const string &_name) : User(_id, _name) {}
+    // Load/Save for books and users
+    bool loadBooks() {
+        const string &filename = booksFile;
+        addChecksumsToLegacyFile(filename);
+        ifstream fin(filename);
+        if (!fin) {
+            return false;
+        }
+        books.clear();
+        int source = RecordStore::open(filename, false);
+        string line, record;
+        streamoff offset = 0;
+        while (getline(fin, line)) {
+            streamoff lineStart = offset;
+            offset += line.size() + 1;
+            if (!verifyChecksum(line, record)) {
+                cout << "Skipping damaged record in " << filename << ".\n";
+                continue;
+            }
+            books.push_back(parseBook(record, locate(source, lineStart)));
+        }
+        fin.close();
+        reindexBooks();
+        return true;
+    }
 
-    virtual void borrowBook(Library &lib, int bookId, int currentDay) override;
-    virtual void returnBook(Library &lib, int bookId, int currentDay) override;
+    // Rewrite the books file. With lazy loading, every book then points at
+    // its new line, so the details read in to write it leave memory again.
+    bool saveBooks() {
+        const string &filename = booksFile;
+        string contents;
+        vector<streamoff> offsets;
+        try {
+            for (auto &bk : books) {
+                offsets.push_back(contents.size());
+                contents += withChecksum(bk.serialize()) + "\n";
+            }
+        } catch (const exception &e) {
+            cerr << "Cannot rewrite " << filename << ": " << e.what() << "\n";
+            return false;
+        }
+        if (!replaceFileAtomically(filename, contents)) {
+            return false;
+        }
+        if (lazy) {
+            int source = RecordStore::open(filename, false);
+            for (size_t i = 0; i < books.size(); i++) {
+                books[i].evictCold(RecordStore::handle(source, offsets[i]));
+            }
+        }
+        return true;
+    }
 
-    int getBorrowLimit() const { return BORROW_LIMIT; }
-    int getBorrowPeriod() const { return BORROW_PERIOD; }
+    bool loadUsers() {
+        const string &filename = usersFile;
+        addChecksumsToLegacyFile(filename);
+        ifstream fin(filename);
+        if (!fin) {
+            return false;
+        }
+        for (auto *u : users) {
+            delete u;
+        }
+        users.clear();
+        userIndex.clear();
 
-    virtual string getType() const override { return "Faculty"; }
+        int source = RecordStore::open(filename, false);
+        string line, record;
+        streamoff offset = 0;
+        while (getline(fin, line)) {
+            streamoff lineStart = offset;
+            offset += line.size() + 1;
+            if (!verifyChecksum(line, record)) {
+                cout << "Skipping damaged record in " << filename << ".\n";
+                continue;
+            }
+            User *user = parseUser(record, locate(source, lineStart));
+            if (user) {
+                upsertUser(user);
+            }
+        }
+        fin.close();
+        return true;
+    }
 
-    virtual void displayDetails() const override {
-        cout << "Role: Faculty\n";
-        User::displayDetails();
-        account.printAccount();
+    // Rewrite the users file; like saveBooks, lazily loaded histories
+    // then point at the new file
+    bool saveUsers() {
+        const string &filename = usersFile;
+        string contents;
+        vector<streamoff> offsets;
+        try {
+            for (auto *u : users) {
+                offsets.push_back(contents.size());
+                contents += withChecksum(u->getType() + "," + u->serialize()) + "\n";
+            }
+        } catch (const exception &e) {
+            cerr << "Cannot rewrite " << filename << ": " << e.what() << "\n";
+            return false;
+        }
+        if (!replaceFileAtomically(filename, contents)) {
+            return false;
+        }
+        if (lazy) {
+            int source = RecordStore::open(filename, false);
+            for (size_t i = 0; i < users.size(); i++) {
+                users[i]->getAccount().evictHistory(
+                    RecordStore::handle(source, offsets[i]));
+            }
+        }
+        return true;
     }
 };
 
 // --------------------
-// Librarian Class
+// Library Class
 // --------------------
-class Librarian : public User {
-public:
-    Librarian(int _id, const string &_name) : User(_id, _name) {}
+// The library network: the catalog and patrons are partitioned across
+// branch shards. Users and books are routed to a branch by id hash; books
+// moved by an inter-branch transfer are recorded in a small directory file
+// that overrides the hash. Recommendations and circulation analytics span
+// the whole network.
+class Library {
+private:
+    vector<Branch *> branches;
+    // Books living somewhere other than their hash branch: bookId -> branch
+    map<int, int> relocated;
+    string directoryFile;
+    RecommendationEngine recommender;
+    // Builds the recommender in the background at startup. Until it is
+    // ready, logins get no suggestions and returns wait in pendingReturns
+    // (prior history, returned book) to be applied when it finishes.
+    thread recommendationBuilder;
+    mutex recommendationLock;
+    bool recommendationsReady = false;
+    vector<pair<vector<int>, int>> pendingReturns;
+    CirculationLog circulation;
+
+    int branchOfUser(int userId) const {
+        int n = static_cast<int>(branches.size());
+        return ((userId % n) + n) % n;
+    }
 
-    virtual void borrowBook(Library &, int, int) override {
-        cout << "Librarian accounts cannot borrow books." << endl;
+    int branchOfBook(int bookId) const {
+        auto it = relocated.find(bookId);
+        if (it != relocated.end()) {
+            return it->second;
+        }
+        int n = static_cast<int>(branches.size());
+        return ((bookId % n) + n) % n;
     }
 
-    virtual void returnBook(Library &, int, int) override {
-        cout << "Librarian accounts cannot return books." << endl;
+    // The directory file records the branch count (which fixes the hash
+    // routing) and every relocated book. A damaged line would misroute
+    // a book, so it stops the load instead of being skipped.
+    void loadDirectory() {
+        ifstream fin(directoryFile);
+        string line, record;
+        while (getline(fin, line)) {
+            size_t comma = string::npos;
+            if (verifyChecksum(line, record)) {
+                comma = record.find(',');
+            }
+            if (comma == string::npos) {
+                throw runtime_error("damaged record in " + directoryFile);
+            }
+            if (record.substr(0, comma) == "count") {
+                continue;
+            }
+            try {
+                int branch = stoi(record.substr(comma + 1));
+                if (branch < 0 || branch >= getBranchCount()) {
+                    throw out_of_range("branch");
+                }
+                relocated[stoi(record.substr(0, comma))] = branch;
+            } catch (const logic_error &) { // invalid_argument / out_of_range
+                throw runtime_error("damaged record in " + directoryFile);
+            }
+        }
     }
 
-    virtual string getType() const override { return "Librarian"; }
+    // Point the directory at the branch now holding a book
+    void setBookBranch(int bookId, int branch) {
+        int n = getBranchCount();
+        if (branch == ((bookId % n) + n) % n) {
+            relocated.erase(bookId);
+        } else {
+            relocated[bookId] = branch;
+        }
+    }
 
-    virtual void displayDetails() const override {
-        cout << "Role: Librarian\n";
-        User::displayDetails();
+    // A crash during a transfer can leave a copy of a book in a branch
+    // the directory does not point at. It is a stale duplicate only if the
+    // branch the directory names really holds the book; otherwise it is
+    // the only copy left, and the directory is pointed at it instead.
+    void reconcileCopies() {
+        bool repointed = false;
+        for (int k = 0; k < getBranchCount(); k++) {
+            for (int bookId : branches[k]->getBookIds()) {
+                int owner = branchOfBook(bookId);
+                if (owner == k) {
+                    continue;
+                }
+                if (branches[owner]->peekBook(bookId)) {
+                    branches[k]->removeBook(bookId);
+                } else {
+                    setBookBranch(bookId, k);
+                    repointed = true;
+                }
+            }
+        }
+        if (repointed && !saveDirectory()) {
+            throw runtime_error("cannot write " + directoryFile);
+        }
     }
-};
 
-// --------------------
-// Library Class
-// --------------------
-class Library {
-private:
-    vector<Book> books;
-    vector<User *> users;
+    bool saveDirectory() const {
+        string contents = withChecksum("count," + to_string(branches.size())) + "\n";
+        for (auto &entry : relocated) {
+            contents += withChecksum(to_string(entry.first) + "," +
+                                     to_string(entry.second)) + "\n";
+        }
+        return replaceFileAtomically(directoryFile, contents);
+    }
 
 public:
-    Library() {}
+    // Upper bound for LMS_BRANCHES: each branch has its own directory,
+    // loader and segment writer thread
+    static constexpr int MAX_BRANCHES = 64;
+
+    // Branch count recorded in a directory file, or 0 if there is none
+    static int storedBranchCount(const string &directory) {
+        ifstream fin(directory);
+        string line, record;
+        if (getline(fin, line) && verifyChecksum(line, record) &&
+            record.rfind("count,", 0) == 0) {
+            return stoi(record.substr(6));
+        }
+        return 0;
+    }
+
+    // A single branch keeps the original books.txt/users.txt layout; with
+    // more, branch k keeps its files under branch-k/
+    // With lazyLoad, book metadata and account histories stay on disk until
+    // first accessed
+    Library(int branchCount, bool lazyLoad,
+            const string &directory = "branches.txt")
+        : directoryFile(directory) {
+        for (int k = 0; k < max(branchCount, 1); k++) {
+            string dir;
+            if (branchCount > 1) {
+                dir = "branch-" + to_string(k) + "/";
+                error_code ec;
+                filesystem::create_directories(dir, ec);
+            }
+            branches.push_back(new Branch(dir + "books.txt", dir + "users.txt",
+                                          dir + "library.seg", lazyLoad));
+        }
+    }
     ~Library() {
-        for (auto *u : users) {
-            delete u;
+        waitForRecommendations();
+        for (auto *branch : branches) {
+            delete branch;
+        }
+    }
+    Library(const Library &) = delete;
+    Library &operator=(const Library &) = delete;
+
+    int getBranchCount() const { return static_cast<int>(branches.size()); }
+
+    // Load every branch in parallel; each only reads its own files
+    // Throws if existing data could not be loaded or migrated; the files
+    // are left as they were
+    void load() {
+        int storedCount = storedBranchCount(directoryFile);
+        loadDirectory();
+        // A single library (no directory yet, or count 1) keeps its data in
+        // the root files
+        if (storedCount <= 1 && branches.size() > 1) {
+            splitRootData();
+        }
+        if (storedCount != getBranchCount() && !saveDirectory()) {
+            throw runtime_error("cannot write " + directoryFile);
+        }
+        vector<future<bool>> pending;
+        for (size_t k = 0; k < branches.size(); k++) {
+            pending.push_back(async(launch::async, [this, k]() {
+                return branches[k]->load();
+            }));
+        }
+        // Wait for every branch before rethrowing any failure
+        bool found = false;
+        exception_ptr failure;
+        for (auto &branchFound : pending) {
+            try {
+                found = branchFound.get() || found;
+            } catch (...) {
+                failure = current_exception();
+            }
+        }
+        if (failure) {
+            rethrow_exception(failure);
+        }
+        reconcileCopies();
+        if (!found) {
+            cout << "Library data files not found. Using defaults.\n";
+        }
+    }
+
+    // An install that ran as a single library keeps its data in the root
+    // books.txt/users.txt/library.seg. When it is started with several
+    // branches, route those records to their hash branches. Every
+    // branch's files are written before the directory file, which commits
+    // the split; the root files are then set aside, so a crash at any
+    // point leaves either the old layout or the new one.
+    void splitRootData() {
+        Branch root("books.txt", "users.txt", "library.seg", false);
+        if (!root.load()) {
+            return;
+        }
+        cout << "Distributing existing data across " << branches.size()
+             << " branches.\n";
+        vector<Book> rootBooks;
+        vector<User *> rootUsers;
+        root.releaseAll(rootBooks, rootUsers);
+        for (auto &bk : rootBooks) {
+            branches[branchOfBook(bk.getId())]->addBook(bk);
+        }
+        for (auto *u : rootUsers) {
+            branches[branchOfUser(u->getId())]->addUser(u);
+        }
+        for (auto *branch : branches) {
+            if (!branch->saveAll()) {
+                throw runtime_error("cannot write the branch data files");
+            }
+        }
+        if (!saveDirectory()) {
+            throw runtime_error("cannot write " + directoryFile);
+        }
+        for (const char *name : {"books.txt", "users.txt", "library.seg"}) {
+            error_code ec;
+            filesystem::rename(name, string(name) + ".pre-branches", ec);
         }
     }
 
     void addBook(const Book &b) {
-        books.push_back(b);
+        branches[branchOfBook(b.getId())]->addBook(b);
     }
 
     void removeBook(int bookId) {
-        auto it = remove_if(books.begin(), books.end(),
-                            [bookId](const Book &bk) { return bk.getId() == bookId; });
-        if (it != books.end()) {
-            books.erase(it, books.end());
+        if (branches[branchOfBook(bookId)]->removeBook(bookId)) {
+            saveChanges();
             cout << "Book removed successfully.\n";
         } else {
             cout << "Book ID not found.\n";
@@ -367,134 +2315,275 @@ public:
 
     int getNextBookId() const {
         int highest = 0;
-        for (auto &bk : books) {
-            if (bk.getId() > highest) {
-                highest = bk.getId();
-            }
+        for (auto *branch : branches) {
+            highest = max(highest, branch->getHighestBookId());
         }
         return highest + 1;
     }
 
     Book *findBook(int bookId) {
-        for (auto &bk : books) {
-            if (bk.getId() == bookId) {
-                return &bk;
-            }
-        }
-        return nullptr;
+        return branches[branchOfBook(bookId)]->findBook(bookId);
     }
 
-    void addUser(User *user) {
-        users.push_back(user);
+    // Takes ownership of the user; false if the id is already taken
+    bool addUser(User *user) {
+        return branches[branchOfUser(user->getId())]->addUser(user);
     }
 
     // Convert user ID from string to int for searching
     User *findUser(const string &userIdStr) {
         int userId = stoi(userIdStr);
-        for (auto *u : users) {
-            if (u->getId() == userId) {
-                return u;
-            }
-        }
-        return nullptr;
+        return branches[branchOfUser(userId)]->findUser(userId);
     }
 
     void removeUser(int userId) {
-        auto it = remove_if(users.begin(), users.end(),
-                            [userId](User *u) { return u->getId() == userId; });
-        if (it != users.end()) {
-            for (auto itr = it; itr != users.end(); ++itr) {
-                delete *itr;
-            }
-            users.erase(it, users.end());
+        if (branches[branchOfUser(userId)]->removeUser(userId)) {
+            saveChanges();
             cout << "User removed successfully.\n";
         } else {
             cout << "User not found.\n";
         }
     }
 
-    void displayBooks() const {
-        for (auto &bk : books) {
-            bk.printDetails();
+    // Available copies across every branch, searched in parallel:
+    // (branch, book) pairs
+    vector<pair<int, Book>> searchAvailable(const string &query) const {
+        vector<future<vector<Book>>> pending;
+        for (auto *branch : branches) {
+            pending.push_back(async(launch::async, [branch, &query]() {
+                return branch->searchAvailable(query);
+            }));
         }
+        vector<pair<int, Book>> matches;
+        for (size_t k = 0; k < pending.size(); k++) {
+            for (auto &bk : pending[k].get()) {
+                matches.push_back({static_cast<int>(k), bk});
+            }
+        }
+        return matches;
     }
 
-    void displayUsers() const {
-        for (auto &u : users) {
-            u->displayDetails();
-            cout << "------------------------\n";
+    // Move an available book to another branch. The directory rewrite is
+    // the commit point: the copy in the target branch is made durable
+    // first, and whichever copy the directory does not point at is
+    // dropped on load, so a crash never loses or duplicates the book.
+    bool transferBook(int bookId, int toBranch) {
+        if (toBranch < 0 || toBranch >= getBranchCount()) {
+            cout << "No such branch.\n";
+            return false;
+        }
+        int fromBranch = branchOfBook(bookId);
+        if (fromBranch == toBranch) {
+            cout << "Book is already at that branch.\n";
+            return false;
+        }
+        Branch &source = *branches[fromBranch];
+        Branch &target = *branches[toBranch];
+        scoped_lock guard(source.lock, target.lock);
+
+        Book *bk = source.findBook(bookId);
+        if (!bk) {
+            cout << "Book ID not found.\n";
+            return false;
+        }
+        if (bk->getStatus() != AVAILABLE) {
+            cout << "Only available books can be transferred.\n";
+            return false;
+        }
+
+        target.addBook(*bk);
+        if (!target.saveChanges() || !target.flushSegment()) {
+            // The copy may not be on disk, so the directory must not
+            // point at it
+            target.removeBook(bookId);
+            target.saveChanges();
+            cout << "Transfer aborted: the copy could not be saved.\n";
+            return false;
+        }
+
+        setBookBranch(bookId, toBranch);
+        if (!saveDirectory()) {
+            setBookBranch(bookId, fromBranch);
+            target.removeBook(bookId);
+            target.saveChanges();
+            return false;
         }
+
+        source.removeBook(bookId);
+        source.saveChanges();
+        cout << "Book transferred to branch " << toBranch << ".\n";
+        return true;
     }
 
-    // Load/Save for books and users
-    void loadBooks(const string &filename) {
-        ifstream fin(filename);
-        if (!fin) {
-            cout << "Books file not found. Using defaults.\n";
-            return;
+    // Append changed records in every branch to its segment. In per-op
+    // mode this returns only once they are on disk.
+    bool saveChanges() {
+        bool ok = true;
+        for (auto *branch : branches) {
+            ok = branch->saveChanges() && ok;
         }
-        books.clear();
-        string line;
-        while (getline(fin, line)) {
-            Book b = Book::deserialize(line);
-            books.push_back(b);
+        if (!ok) {
+            cout << "Error: changes could not be saved to disk.\n";
         }
-        fin.close();
+        return ok;
     }
 
-    void saveBooks(const string &filename) {
-        ofstream fout(filename);
-        for (auto &bk : books) {
-            fout << bk.serialize() << "\n";
+    // Start persisting changes continuously to each branch's segment;
+    // false if any segment cannot be opened
+    bool openSegments(DurabilityMode mode) {
+        bool ok = true;
+        for (auto *branch : branches) {
+            ok = branch->openSegment(mode) && ok;
         }
-        fout.close();
+        return ok;
     }
 
-    void loadUsers(const string &filename) {
-        ifstream fin(filename);
-        if (!fin) {
-            cout << "Users file not found. Using defaults.\n";
-            return;
+    // Stop the segment writers, then merge any that have grown large. A
+    // branch whose segment missed changes has its data files rewritten
+    // instead. Returns false if some changes could not be saved at all.
+    bool closeSegments() {
+        // Merging rewrites the data files the background build reads
+        waitForRecommendations();
+        bool ok = true;
+        for (size_t k = 0; k < branches.size(); k++) {
+            // With many branches, only report the ones that wrote something
+            if (branches.size() > 1) {
+                branches[k]->closeSegment("Branch " + to_string(k), true);
+            } else {
+                branches[k]->closeSegment("Segment writer", false);
+            }
+            if (branches[k]->hasUnsavedChanges()) {
+                ok = branches[k]->mergeSegment(true) && ok;
+            } else {
+                branches[k]->mergeSegment();
+            }
         }
-        for (auto *u : users) {
-            delete u;
+        return ok;
+    }
+
+    // Batch-compute co-borrowing recommendations from all histories, in
+    // the background so it does not delay the first prompt. The build works
+    // on a snapshot of the histories (just their locations while they are
+    // on disk) and never touches the live accounts. With lazy loading,
+    // histories read for the build are not kept resident.
+    void buildRecommendations() {
+        typedef vector<pair<int64_t, vector<int>>> Snapshot;
+        Snapshot histories;
+        for (auto *branch : branches) {
+            for (auto *u : branch->getUsers()) {
+                histories.push_back(u->getAccount().historySnapshot());
+            }
         }
-        users.clear();
+        auto build = [this](Snapshot snapshot) {
+            recommender.rebuild(snapshot.size(), [&snapshot](size_t i) {
+                try {
+                    return Account::readSnapshot(snapshot[i]);
+                } catch (const exception &e) {
+                    cerr << e.what() << "\n";
+                    return vector<int>();
+                }
+            });
+            lock_guard<mutex> guard(recommendationLock);
+            for (auto &pending : pendingReturns) {
+                recommender.recordReturn(pending.first, pending.second);
+            }
+            pendingReturns.clear();
+            recommendationsReady = true;
+        };
+        recommendationBuilder = thread(build, move(histories));
+    }
 
-        string line;
-        while (getline(fin, line)) {
-            istringstream iss(line);
-            string type, idStr, nm, accData;
-            getline(iss, type, ',');
-            getline(iss, idStr, ',');
-            getline(iss, nm, ',');
-            getline(iss, accData);
+    void waitForRecommendations() {
+        if (recommendationBuilder.joinable()) {
+            recommendationBuilder.join();
+        }
+    }
+
+    // Keep recommendations current as books come back; queued while the
+    // background build is still running
+    void recordReturn(const Account &acc, int bookId) {
+        lock_guard<mutex> guard(recommendationLock);
+        if (recommendationsReady) {
+            recommender.recordReturn(acc.getHistory(), bookId);
+        } else {
+            pendingReturns.emplace_back(acc.getHistory(), bookId);
+        }
+    }
 
-            int userId = stoi(idStr);
-            User *user = nullptr;
+    // Empty until the background build has finished
+    const vector<int> &getRecommendations(int bookId) {
+        static const vector<int> none;
+        lock_guard<mutex> guard(recommendationLock);
+        return recommendationsReady ? recommender.recommend(bookId) : none;
+    }
 
-            if (type == "Student") {
-                user = new Student(userId, nm);
-            } else if (type == "Faculty") {
-                user = new Faculty(userId, nm);
-            } else if (type == "Librarian") {
-                user = new Librarian(userId, nm);
-            }
+    // Start appending circulation events to the columnar store
+    bool openCirculationLog(const string &baseName) {
+        return circulation.open(baseName);
+    }
 
-            if (user) {
-                user->getAccount() = Account::deserialize(accData);
-                users.push_back(user);
+    void logEvent(EventType type, int userId, int bookId, double value) {
+        circulation.append(type, userId, bookId, value);
+    }
+
+    // Batch analytics over the circulation log
+    void printCirculationReport(int termDays) const {
+        time_t now = time(nullptr);
+        int64_t since = static_cast<int64_t>(now) -
+                        static_cast<int64_t>(termDays) * 60 * 60 * 24;
+
+        auto scanBegin = chrono::steady_clock::now();
+        cout << "Most borrowed titles (last " << termDays << " days):\n";
+        CirculationLog::Report report =
+            circulation.report(since, 10, getNextBookId() - 1);
+        if (report.topBorrowed.empty()) {
+            cout << "  None\n";
+        }
+        for (auto &entry : report.topBorrowed) {
+            const Book *bk = branches[branchOfBook(entry.first)]->peekBook(entry.first);
+            cout << "  [" << entry.first << "] "
+                 << (bk ? bk->getTitle() : "(removed)") << ": "
+                 << entry.second << " loan(s)\n";
+        }
+
+        // Format fixed-point numbers locally so cout's settings stay intact
+        ostringstream loan;
+        loan << fixed << setprecision(1) << report.averageLoanDays;
+        cout << "Average loan length: " << loan.str() << " day(s)\n";
+
+        cout << "Fines collected per week:\n";
+        if (report.finesPerWeek.empty()) {
+            cout << "  None\n";
+        }
+        for (auto &entry : report.finesPerWeek) {
+            time_t weekStart = static_cast<time_t>(entry.first);
+            ostringstream amount;
+            amount << fixed << setprecision(1) << entry.second;
+            cout << "  Week of " << put_time(gmtime(&weekStart), "%Y-%m-%d")
+                 << ": " << amount.str() << " rupees\n";
+        }
+
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                    scanBegin).count();
+        ostringstream elapsed;
+        elapsed << fixed << setprecision(1) << ms;
+        cout << "(" << circulation.size() << " event(s) analysed in "
+             << elapsed.str() << " ms)\n";
+    }
+
+    void displayBooks() const {
+        for (size_t k = 0; k < branches.size(); k++) {
+            if (branches.size() > 1) {
+                cout << "=== Branch " << k << " ===\n";
             }
+            branches[k]->displayBooks();
         }
-        fin.close();
     }
 
-    void saveUsers(const string &filename) {
-        ofstream fout(filename);
-        for (auto *u : users) {
-            fout << u->getType() << "," << u->serialize() << "\n";
+    void displayUsers() const {
+        for (auto *branch : branches) {
+            branch->displayUsers();
         }
-        fout.close();
     }
 };
 
@@ -522,6 +2611,8 @@ void Student::borrowBook(Library &lib, int bookId, int currentDay) {
     int due = currentDay + BORROW_PERIOD;
     account.addBorrowedBook(bookId, due);
     bk->setStatus(BORROWED);
+    lib.logEvent(EV_BORROW, id, bookId, 0);
+    lib.saveChanges();
     cout << "Book borrowed. Due on day " << due << ".\n";
 }
 
@@ -536,19 +2627,32 @@ void Student::returnBook(Library &lib, int bookId, int currentDay) {
         cout << "You didn't borrow this book.\n";
         return;
     }
+    // The return is added to the history, so it must be readable first
+    if (!account.ensureHistory()) {
+        cout << "Your borrowing history cannot be read right now. "
+                "Please try again.\n";
+        return;
+    }
     int due = borrowed.at(bookId);
-    if (currentDay > due) {
-        int overdueDays = currentDay - due;
-        double penalty = overdueDays * getFineRate();
+    int overdueDays = currentDay - due;
+    double penalty = 0;
+    if (overdueDays > 0) {
+        penalty = overdueDays * getFineRate();
         account.addFine(penalty);
+        lib.logEvent(EV_FINE, id, bookId, penalty);
+    }
+    lib.logEvent(EV_RETURN, id, bookId, currentDay - (due - BORROW_PERIOD));
+    account.removeBorrowedBook(bookId);
+    lib.recordReturn(account, bookId);
+    account.addToHistory(bookId);
+    bk->setStatus(AVAILABLE);
+    lib.saveChanges();
+    if (overdueDays > 0) {
         cout << "Late return. Overdue by " << overdueDays
              << " day(s). Fine: " << penalty << " rupees.\n";
     } else {
         cout << "Returned on time.\n";
     }
-    account.removeBorrowedBook(bookId);
-    account.addToHistory(bookId);
-    bk->setStatus(AVAILABLE);
 }
 
 // --------------------
@@ -578,10 +2682,12 @@ void Faculty::borrowBook(Library &lib, int bookId, int currentDay) {
     int due = currentDay + BORROW_PERIOD;
     account.addBorrowedBook(bookId, due);
     bk->setStatus(BORROWED);
+    lib.logEvent(EV_BORROW, id, bookId, 0);
+    lib.saveChanges();
     cout << "Book borrowed. Due on day " << due << ".\n";
 }
 
-void Faculty::returnBook(Library &lib, int bookId, int /*currentDay*/) {
+void Faculty::returnBook(Library &lib, int bookId, int currentDay) {
     Book *bk = lib.findBook(bookId);
     if (!bk) {
         cout << "Book not found.\n";
@@ -592,23 +2698,75 @@ void Faculty::returnBook(Library &lib, int bookId, int /*currentDay*/) {
         cout << "You didn't borrow this book.\n";
         return;
     }
+    // The return is added to the history, so it must be readable first
+    if (!account.ensureHistory()) {
+        cout << "Your borrowing history cannot be read right now. "
+                "Please try again.\n";
+        return;
+    }
     // No fines for faculty
-    cout << "Book returned.\n";
+    int due = borrowed.at(bookId);
+    lib.logEvent(EV_RETURN, id, bookId, currentDay - (due - BORROW_PERIOD));
     account.removeBorrowedBook(bookId);
+    lib.recordReturn(account, bookId);
     account.addToHistory(bookId);
     bk->setStatus(AVAILABLE);
+    lib.saveChanges();
+    cout << "Book returned.\n";
 }
 
 // --------------------
 // Main Function
 // --------------------
 int main() {
-    Library lib;
+    auto startupBegin = chrono::steady_clock::now();
+
+    // Number of branch libraries: LMS_BRANCHES on first start, or to split
+    // a single library into branches; after that the count is fixed by
+    // branches.txt, since it determines routing
+    int branchCount = Library::storedBranchCount("branches.txt");
+    const char *configured = getenv("LMS_BRANCHES");
+    if (configured) {
+        int requested = max(atoi(configured), 1);
+        if (requested > Library::MAX_BRANCHES) {
+            cout << "LMS_BRANCHES is limited to " << Library::MAX_BRANCHES
+                 << ".\n";
+            requested = Library::MAX_BRANCHES;
+        }
+        if (branchCount <= 1) {
+            branchCount = requested;
+        } else if (requested != branchCount) {
+            cout << "Ignoring LMS_BRANCHES=" << requested << ": branches.txt "
+                 << "fixes the count at " << branchCount << ".\n";
+        }
+    }
+    branchCount = max(branchCount, 1);
+    // LMS_EAGER_LOAD=1 reads every record in full at startup instead of
+    // faulting in book metadata and account histories on first access
+    const char *eager = getenv("LMS_EAGER_LOAD");
+    Library lib(branchCount, !(eager && string(eager) == "1"));
     int today = getTodayAsInteger();
 
     // Load from existing files or set defaults
-    lib.loadBooks("books.txt");
-    lib.loadUsers("users.txt");
+    try {
+        lib.load();
+    } catch (const exception &e) {
+        cout << "Error: " << e.what() << ". Data left unchanged; exiting.\n";
+        return 1;
+    }
+    lib.buildRecommendations();
+    lib.openCirculationLog("events");
+
+    // Segment durability: LMS_DURABILITY=per-op fsyncs every record,
+    // anything else groups records into batched commits
+    const char *durability = getenv("LMS_DURABILITY");
+    if (!lib.openSegments(durability && string(durability) == "per-op"
+                              ? DURABLE_PER_OP
+                              : DURABLE_BATCHED)) {
+        cout << "Error: cannot open the segment files; changes could not be "
+                "saved. Exiting.\n";
+        return 1;
+    }
 
     // If no initial books, add a set of 10
     if (!lib.findBook(1)) {
@@ -649,8 +2807,28 @@ int main() {
         lib.addUser(new Librarian(301, "Librarian A"));
     }
 
+    // LMS_STARTUP_STATS=1 reports time to first prompt and resident memory
+    const char *startupStats = getenv("LMS_STARTUP_STATS");
+    if (startupStats && string(startupStats) == "1") {
+        auto report = [&startupBegin](const string &milestone) {
+            ostringstream ms;
+            ms << fixed << setprecision(1)
+               << chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                  startupBegin).count();
+            cout << "Startup: " << ms.str() << " ms to " << milestone << ", "
+                 << residentKiB() << " KiB resident\n";
+        };
+        report("first prompt");
+        // The recommendation build continues in the background; report
+        // when it is done too, so both load modes are measured over the
+        // same work
+        lib.waitForRecommendations();
+        report("recommendations ready");
+    }
+
     // Simple login loop
     while (true) {
+        lib.saveChanges();
         cout << "\nEnter User ID to log in (or 'exit' to quit): ";
         string userIdStr;
         cin >> userIdStr;
@@ -674,10 +2852,29 @@ int main() {
                  << user->getAccount().getBorrowedBooks().size() << "\n";
             cout << "Outstanding fines: "
                  << user->getAccount().getFine() << " rupees\n";
+            // Suggest titles co-borrowed with the most recent return
+            const vector<int> &history = user->getAccount().getHistory();
+            if (!history.empty()) {
+                Book *last = lib.findBook(history.back());
+                const vector<int> &recs = lib.getRecommendations(history.back());
+                if (last && !recs.empty()) {
+                    cout << "Patrons who borrowed \"" << last->getTitle()
+                         << "\" also borrowed:\n";
+                    for (int recId : recs) {
+                        Book *rec = lib.findBook(recId);
+                        if (rec) {
+                            cout << "  [" << recId << "] " << rec->getTitle()
+                                 << "\n";
+                        }
+                    }
+                }
+            }
             int choice;
             while (true) {
+                lib.saveChanges();
                 cout << "\n1. Borrow Book\n2. Return Book\n3. Pay Fine\n"
-                     << "4. View Account\n5. Logout\nChoice: ";
+                     << "4. View Account\n5. Search Available Books\n"
+                     << "6. Logout\nChoice: ";
                 cin >> choice;
 
                 if (choice == 1) {
@@ -697,11 +2894,30 @@ int main() {
                     } else {
                         cout << "Paying " << currentFine << " rupees...\n";
                         user->getAccount().clearFine();
+                        lib.logEvent(EV_PAY, user->getId(), 0, currentFine);
+                        lib.saveChanges();
                         cout << "Fines cleared.\n";
                     }
                 } else if (choice == 4) {
                     user->displayDetails();
                 } else if (choice == 5) {
+                    string query;
+                    cout << "Title contains: ";
+                    cin.ignore();
+                    getline(cin, query);
+                    auto matches = lib.searchAvailable(query);
+                    if (matches.empty()) {
+                        cout << "No available copies found.\n";
+                    }
+                    for (auto &match : matches) {
+                        cout << "  [" << match.second.getId() << "] "
+                             << match.second.getTitle();
+                        if (lib.getBranchCount() > 1) {
+                            cout << " (branch " << match.first << ")";
+                        }
+                        cout << "\n";
+                    }
+                } else if (choice == 6) {
                     cout << "Logging out...\n";
                     break;
                 } else {
@@ -713,9 +2929,11 @@ int main() {
         else if (user->getType() == "Librarian") {
             int choice;
             while (true) {
+                lib.saveChanges();
                 cout << "\n1. Display Books\n2. Display Users\n3. Add Book\n"
                      << "4. Remove Book\n5. Add User\n6. Remove User\n"
-                     << "7. Logout\nChoice: ";
+                     << "7. Circulation Report\n8. Transfer Book\n"
+                     << "9. Logout\nChoice: ";
                 cin >> choice;
                 if (choice == 1) {
                     lib.displayBooks();
@@ -737,6 +2955,7 @@ int main() {
                     cin >> isbn;
                     int newId = lib.getNextBookId();
                     lib.addBook(Book(newId, title, author, pub, year, isbn));
+                    lib.saveChanges();
                     cout << "Book added.\n";
                 } else if (choice == 4) {
                     int bkId;
@@ -754,22 +2973,41 @@ int main() {
                     cout << "Role (Student/Faculty/Librarian): ";
                     cin >> role;
 
+                    User *newUser = nullptr;
                     if (role == "Student" || role == "student") {
-                        lib.addUser(new Student(uid, nm));
+                        newUser = new Student(uid, nm);
                     } else if (role == "Faculty" || role == "faculty") {
-                        lib.addUser(new Faculty(uid, nm));
+                        newUser = new Faculty(uid, nm);
                     } else if (role == "Librarian" || role == "librarian") {
-                        lib.addUser(new Librarian(uid, nm));
-                    } else {
+                        newUser = new Librarian(uid, nm);
+                    }
+                    if (!newUser) {
                         cout << "Invalid role.\n";
+                    } else if (!lib.addUser(newUser)) {
+                        cout << "A user with that ID already exists.\n";
+                    } else {
+                        lib.saveChanges();
+                        cout << "User added.\n";
                     }
-                    cout << "User added.\n";
                 } else if (choice == 6) {
                     int removeId;
                     cout << "Enter User ID to remove: ";
                     cin >> removeId;
                     lib.removeUser(removeId);
                 } else if (choice == 7) {
+                    int termDays;
+                    cout << "Days to include: ";
+                    cin >> termDays;
+                    lib.printCirculationReport(termDays);
+                } else if (choice == 8) {
+                    int bkId, toBranch;
+                    cout << "Enter Book ID to transfer: ";
+                    cin >> bkId;
+                    cout << "Destination branch (0-" << lib.getBranchCount() - 1
+                         << "): ";
+                    cin >> toBranch;
+                    lib.transferBook(bkId, toBranch);
+                } else if (choice == 9) {
                     cout << "Logging out...\n";
                     break;
                 } else {
@@ -779,9 +3017,12 @@ int main() {
         }
     }
 
-    // Save all data
-    lib.saveBooks("books.txt");
-    lib.saveUsers("users.txt");
-    cout << "Library data saved. Goodbye.\n";
+    // Save outstanding changes, merging the segment if it has grown large
+    lib.saveChanges();
+    if (lib.closeSegments()) {
+        cout << "Library data saved. Goodbye.\n";
+    } else {
+        cout << "Error: some changes could not be saved. Goodbye.\n";
+    }
     return 0;
 }